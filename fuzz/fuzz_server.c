@@ -0,0 +1,349 @@
+//Fuzz harness for the request handling pipeline. Drives determine_request(), get_cookie() and
+//handle_request() in-process for two players, writing responses to /dev/null instead of sockets.
+//
+//An input is a list of records, each starting on its own line with '@' and the player number:
+//  @0
+//  GET / HTTP/1.1
+//  ...
+//  @1
+//  POST / HTTP/1.1
+//  ...
+//Input without a leading '@' is treated as a single request from player 0.
+//
+//'make fuzz' builds a libFuzzer binary with clang, 'make fuzz-check' replays the seed corpus
+//in fuzz/corpus along with deterministic mutations of it, using any compiler. 'make alloc-check'
+//replays the same inputs with COUNT_ALLOCS and fails if handling a request allocates memory.
+//Keep the win table in memory so one input can't affect the next through the stats file.
+#define KEYWORD_STATS_FILE ""
+#define main server_main
+#include "../server.c"
+#undef main
+
+#include <stdint.h>
+
+static char const* const HTML_FILES[] = {
+  "1_intro.html", "2_start.html", "3_first_turn.html", "4_accepted.html",
+  "5_discarded.html", "6_endgame.html", "7_gameover.html"
+};
+#define NUM_HTML_FILES 7
+
+//State which outlives a single input, set up on the first call.
+static struct keyword** kwords;
+static char** cookies;
+static char* buffer;
+static struct keyword_stats stats;
+static struct capacity capacity;
+static int initialised=0;
+
+//The scratch directory and the pages as they were when the harness started.
+static char scratch_dir[]="/tmp/fuzz_server_XXXXXX";
+static char pages[NUM_HTML_FILES][MAX_HTML_SIZE];
+static int page_sizes[NUM_HTML_FILES];
+static int start_image;
+
+#ifdef COUNT_ALLOCS
+//Linked with --wrap so every malloc, calloc and realloc from the server goes through here.
+//Once storage is allocated, any allocation while handling requests is a failure.
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+static int counting=0;
+
+static void count_alloc(char const* name, size_t size) {
+  if (counting) {
+    fprintf(stderr, "%s(%zu) called while handling a request\n", name, size);
+    abort();
+  }
+}
+
+void* __wrap_malloc(size_t size) {
+  count_alloc("malloc", size);
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+  count_alloc("calloc", count*size);
+  return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+  count_alloc("realloc", size);
+  return __real_realloc(ptr, size);
+}
+#endif
+
+//Write the saved pages back, undoing any image rotation from stage six.
+static void restore_pages() {
+  for (int i=0; i<NUM_HTML_FILES; i++) {
+    int fd=open(HTML_FILES[i], O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd<0 || write(fd, pages[i], page_sizes[i])!=page_sizes[i]) {
+      perror("error restoring page");
+      abort();
+    }
+    close(fd);
+  }
+}
+
+static void remove_scratch() {
+  for (int i=0; i<NUM_HTML_FILES; i++) {
+    unlink(HTML_FILES[i]);
+  }
+  if (chdir("/")==0) {
+    rmdir(scratch_dir);
+  }
+}
+
+//Read the HTML pages and run from a scratch copy of them, since stage six rewrites them.
+//The copy is removed when the harness exits.
+static void copy_pages_to_scratch() {
+  for (int i=0; i<NUM_HTML_FILES; i++) {
+    int fd=open(HTML_FILES[i], O_RDONLY);
+    if (fd<0) {
+      perror("error opening page, run the harness from the repository root");
+      abort();
+    }
+    page_sizes[i]=read(fd, pages[i], MAX_HTML_SIZE);
+    close(fd);
+    if (page_sizes[i]<0) {
+      abort();
+    }
+  }
+  if (mkdtemp(scratch_dir)==NULL || chdir(scratch_dir)<0) {
+    perror("error making scratch directory");
+    abort();
+  }
+  atexit(remove_scratch);
+  restore_pages();
+}
+
+//A small capacity profile, parsed the same way as the server's arguments, so the limits are hit often.
+static char* profile[]={"server", "127.0.0.1", "0", "keywords=8", "keyword_size=24", "cookies=3", "buffer_size=1024"};
+
+static void initialise() {
+  copy_pages_to_scratch();
+  if (!get_capacity(&capacity, sizeof(profile)/sizeof(profile[0]), profile)) {
+    abort();
+  }
+  kwords=(struct keyword**)malloc(sizeof(struct keyword*)*MAX_PLAYERS);
+  cookies=(char**)malloc(sizeof(char*)*capacity.max_cookies);
+  buffer=(char*)malloc(capacity.buffer_size);
+  if (kwords==NULL || cookies==NULL || buffer==NULL || !allocate_storage(kwords, cookies, &capacity)) {
+    abort();
+  }
+  start_image=image_of_file("3_first_turn.html");
+  initialised=1;
+}
+
+//True if the two players' guess lists share a keyword, meaning the round has been won.
+static int round_won(int nkwords[]) {
+  for (int i=0; i<nkwords[0]; i++) {
+    for (int j=0; j<nkwords[1]; j++) {
+      if (strcmp(kwords[0][i].key, kwords[1][j].key)==0) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void fail(char const* message, int cur_player, int before, int after) {
+  fprintf(stderr, "player %d, stage %d to %d: %s\n", cur_player, before, after, message);
+  abort();
+}
+
+//Invariants which must hold after every request, given the stages and cookie count from before it.
+static void check_invariants(int players[], int nkwords[], int playersstage[], int stages_before[], int cookies_before, int won_before, int cur_player, char* request) {
+  for (int i=0; i<MAX_PLAYERS; i++) {
+    if (playersstage[i]<0 || playersstage[i]>7) {
+      fail("stage out of range", i, stages_before[i], playersstage[i]);
+    }
+    if (nkwords[i]<0 || nkwords[i]>capacity.max_keywords) {
+      fail("keyword count out of range", i, stages_before[i], playersstage[i]);
+    }
+    //A player who has been removed must have been reset.
+    if (players[i]==-1 && (playersstage[i]!=0 || nkwords[i]!=0)) {
+      fail("removed player was not reset", i, stages_before[i], playersstage[i]);
+    }
+  }
+  if (num_cookies(cookies, capacity.max_cookies)>capacity.max_cookies) {
+    fail("too many cookies", cur_player, stages_before[cur_player], playersstage[cur_player]);
+  }
+
+  //Only the requesting player's stage can change, check how it got there.
+  int before=stages_before[cur_player];
+  int after=playersstage[cur_player];
+  int other_before=stages_before[other_player(cur_player)];
+  if (after==2 && before!=2) {
+    int cookie=get_cookie(request);
+    if ((cookie<0 || cookie>=cookies_before) && strstr(request, "user=")==NULL) {
+      fail("started without a valid cookie or a username", cur_player, before, after);
+    }
+  }
+  if (after==4 && before!=4 && (other_before<3 || other_before>5)) {
+    fail("guess accepted while the other player wasn't playing", cur_player, before, after);
+  }
+  if (after==6 && before!=6 && !round_won(nkwords)) {
+    fail("round ended without matching guesses", cur_player, before, after);
+  }
+  //Once the round is won, neither player may have another guess accepted.
+  if (won_before && after==4) {
+    fail("guess accepted after the round was won", cur_player, before, after);
+  }
+}
+
+//Run one request from cur_player the same way the main server loop does.
+static void run_request(char const* data, size_t size, int cur_player, int players[], int nkwords[], int playersstage[], fd_set* masterfds) {
+  char request_type[MAX_REQUEST_TYPE];
+  char* username=NULL;
+
+  //Connect the player if they aren't already.
+  if (players[cur_player]==-1) {
+    int fd=open("/dev/null", O_WRONLY);
+    if (fd<0 || fd>=FD_SETSIZE) {
+      abort();
+    }
+    players[cur_player]=fd;
+    FD_SET(fd, masterfds);
+  }
+  int cur_fd=players[cur_player];
+
+  if (size>capacity.buffer_size-1) {
+    size=capacity.buffer_size-1;
+  }
+  memcpy(buffer, data, size);
+  buffer[size]=0;
+  memset(request_type, 0, MAX_REQUEST_TYPE);
+  determine_request(buffer, request_type);
+
+  int stages_before[MAX_PLAYERS]={playersstage[0], playersstage[1]};
+  int cookies_before=num_cookies(cookies, capacity.max_cookies);
+  int won_before=round_won(nkwords);
+
+  if (strstr(buffer, "favicon.ico")) {
+    send_404(cur_fd);
+  } else {
+    handle_request(playersstage[cur_player], buffer, players, cur_fd, nkwords, kwords, playersstage, masterfds, cur_player, username, request_type, cookies, &stats, &capacity);
+  }
+
+  //Handlers may rewrite the buffer, so check against a fresh copy.
+  memcpy(buffer, data, size);
+  buffer[size]=0;
+  check_invariants(players, nkwords, playersstage, stages_before, cookies_before, won_before, cur_player, buffer);
+}
+
+int LLVMFuzzerTestOneInput(uint8_t const* data, size_t size) {
+  if (!initialised) {
+    initialise();
+  }
+#ifdef COUNT_ALLOCS
+  counting=1;
+#endif
+
+  //Every input starts a fresh game on the same image, with no past wins.
+  restore_pages();
+  memset(&stats, 0, sizeof(stats));
+  stats.image=start_image;
+  int players[MAX_PLAYERS]={-1,-1};
+  int nkwords[MAX_PLAYERS]={0,0};
+  int playersstage[MAX_PLAYERS]={0,0};
+  fd_set masterfds;
+  FD_ZERO(&masterfds);
+  for (int i=0; i<capacity.max_cookies; i++) {
+    cookies[i][0]='\0';
+  }
+
+  char const* input=(char const*)data;
+  if (size==0 || input[0]!='@') {
+    run_request(input, size, 0, players, nkwords, playersstage, &masterfds);
+  }
+  else {
+    size_t start=0;
+    while (start<size) {
+      //Record header is '@', the player number, then a newline.
+      int cur_player=(start+1<size) ? (input[start+1]-'0')&1 : 0;
+      size_t body=start+1;
+      while (body<size && input[body]!='\n') {
+        body++;
+      }
+      if (body<size) {
+        body++;
+      }
+      //The record runs up to the next line starting with '@'.
+      size_t end=body;
+      while (end<size && !(input[end]=='\n' && end+1<size && input[end+1]=='@')) {
+        end++;
+      }
+      run_request(input+body, end-body, cur_player, players, nkwords, playersstage, &masterfds);
+      start=end+1;
+    }
+  }
+
+  for (int i=0; i<MAX_PLAYERS; i++) {
+    if (players[i]!=-1) {
+      kill_player(players, players[i], nkwords, kwords, playersstage, &masterfds, i);
+    }
+  }
+#ifdef COUNT_ALLOCS
+  counting=0;
+#endif
+  return 0;
+}
+
+#ifdef STANDALONE_FUZZ
+#define MUTATIONS_PER_SEED 2000
+#define MAX_SEED_SIZE 65536
+
+//Replays each seed file given on the command line, then deterministic mutations of it.
+int main(int argc, char *argv[]) {
+  static uint8_t mutated[MAX_SEED_SIZE];
+  uint8_t* seeds[argc];
+  int sizes[argc];
+
+  //Read every seed up front, the harness moves to a scratch directory on its first run.
+  for (int i=1; i<argc; i++) {
+    seeds[i]=(uint8_t*)malloc(MAX_SEED_SIZE);
+    int fd=open(argv[i], O_RDONLY);
+    if (seeds[i]==NULL || fd<0) {
+      perror(argv[i]);
+      return EXIT_FAILURE;
+    }
+    sizes[i]=read(fd, seeds[i], MAX_SEED_SIZE/2);
+    close(fd);
+    if (sizes[i]<0) {
+      perror(argv[i]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  srand(1);
+  for (int i=1; i<argc; i++) {
+    LLVMFuzzerTestOneInput(seeds[i], sizes[i]);
+
+    for (int m=0; m<MUTATIONS_PER_SEED; m++) {
+      size_t size=sizes[i];
+      memcpy(mutated, seeds[i], size);
+      //Flip, overwrite, duplicate or cut a few spots.
+      int edits=1+rand()%4;
+      for (int e=0; e<edits && size>0; e++) {
+        size_t at=rand()%size;
+        int kind=rand()%4;
+        if (kind==0) {
+          mutated[at]^=1<<(rand()%8);
+        } else if (kind==1) {
+          mutated[at]="@01&=%+ ;\r\nA\xff"[rand()%13];
+        } else if (kind==2 && size*2<MAX_SEED_SIZE) {
+          size_t len=size-at;
+          memmove(mutated+at+len, mutated+at, len);
+          size+=len;
+        } else {
+          size=at;
+        }
+      }
+      LLVMFuzzerTestOneInput(mutated, size);
+    }
+    printf("%s: %d runs\n", argv[i], 1+MUTATIONS_PER_SEED);
+    free(seeds[i]);
+  }
+  return EXIT_SUCCESS;
+}
+#endif
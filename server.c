@@ -1,9 +1,11 @@
 //Written by Max Bonifacio
 #include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netdb.h>
@@ -22,11 +24,22 @@
 #define PORT_INDEX 2
 #define MAX_PLAYERS 2
 #define CLIENT_ADDRESS_STRING_SIZE 128
+//Defaults for the capacity profile, each can be changed on the command line.
 #define MAX_KEYWORDS_PER_PLAYER 100
 #define MAX_KEYWORD_SIZE 512
 #define BUFFER_SIZE 2049
 #define MAX_REQUEST_TYPE 128
 #define MAX_REQUESTED_FILE 512
+#define MAX_COOKIES 50
+#define MAX_CAPACITY 1000000
+#define MAX_USERNAME_SIZE 64
+#define MAX_HTML_SIZE 10000
+#define NUM_IMAGES 4
+#define MAX_WINNING_KEYWORDS 32
+//Where winning keywords are kept between runs. Defining it as "" keeps them in memory only.
+#ifndef KEYWORD_STATS_FILE
+#define KEYWORD_STATS_FILE "keyword_stats.txt"
+#endif
 
 //HTTP header constants, from 'http-server.c' sample code.
 static char const* const HTTP_200_FORMAT = "HTTP/1.1 200 OK\r\n\
@@ -42,44 +55,89 @@ static int const HTTP_404_LENGTH = 45;
 static char const* const COOKIES = "cookies";
 static char const* const COOKIE = "Set-Cookie: id=";
 
+//Capacities the server allocates for at startup. Nothing is allocated while handling requests,
+//so these are hard limits: extra guesses and usernames are turned away.
+struct capacity {
+  int max_keywords;
+  int max_keyword_size;
+  int max_cookies;
+  int buffer_size;
+};
+
+//A player's guess, decoded for display and normalized for comparison. Both point into storage
+//of max_keyword_size bytes made by allocate_storage().
+struct keyword {
+  unsigned long hash;
+  char* display;
+  char* key;
+};
+
+//Keywords which have won rounds on each image, most frequent first, saved between runs of the server.
+//Indexed by image number, 1 to NUM_IMAGES, and keywords of MAX_KEYWORD_SIZE or longer aren't counted.
+//Also tracks the pair of guesses which won the current round.
+struct keyword_stats {
+  int image;
+  int round_won;
+  int won_index[MAX_PLAYERS];
+  unsigned long won_hash;
+  int unsaved;
+  int nwinners[NUM_IMAGES+1];
+  int count[NUM_IMAGES+1][MAX_WINNING_KEYWORDS];
+  unsigned long hash[NUM_IMAGES+1][MAX_WINNING_KEYWORDS];
+  char key[NUM_IMAGES+1][MAX_WINNING_KEYWORDS][MAX_KEYWORD_SIZE];
+};
+
 //Game flow functions
-void handle_request(int stage, char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* username, char* request_type, char* cookies[]);
-void handle_stage_zero(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* username, char* cookies[]);
-void handle_stage_one(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* username, char* cookies[]);
-void handle_stage_two(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* request_type);
-void handle_stage_three(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* request_type);
-void handle_stage_four(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player);
-void handle_stage_five(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player);
-void handle_stage_six(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* request_type);
+void handle_request(int stage, char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* username, char* request_type, char** cookies, struct keyword_stats* stats, struct capacity* capacity);
+void handle_stage_zero(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* username, char** cookies, struct capacity* capacity);
+void handle_stage_one(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* username, char** cookies, struct capacity* capacity);
+void handle_stage_two(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* request_type);
+void handle_stage_three(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* request_type, struct keyword_stats* stats, struct capacity* capacity);
+void handle_stage_four(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, struct keyword_stats* stats, struct capacity* capacity);
+void handle_stage_five(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, struct keyword_stats* stats, struct capacity* capacity);
+void handle_stage_six(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* request_type, struct keyword_stats* stats);
 
 //Game flow helper functions
 int getServerAddress(int *port, char IP[], int argc, char *argv[]);
-void kill_player(int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player);
+int get_capacity(struct capacity* capacity, int argc, char *argv[]);
+int allocate_storage(struct keyword** kwords, char** cookies, struct capacity* capacity);
+void kill_player(int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player);
 int send_file(char filename[], int receiversockfd, char buff[]);
-void send_accepted(int cur_player, int nkwords[], char*** kwords, int playersstage[], int fd);
+void send_accepted(int cur_player, int nkwords[], struct keyword** kwords, int playersstage[], int fd);
 void send_404(int fd);
 void send_400(int fd);
-void player_quit(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player);
+void player_quit(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player);
 int num_players(int players[]);
 int get_player(int players[], int playerfd);
 void remove_player(int players[], int playerfd);
 int add_player(int players[], int newplayerfd);
 int other_player(int this_player);
-void send_to_stage(char *stage, char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player);
+void send_to_stage(char *stage, char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player);
 
 //String reading and manipulation functions
 void determine_request(char *curr_request, char *request_type);
 int get_cookie(char* request);
-int check_victory(char ***kwords, int nkwords[]);
-void reset_kword_of_player(char ***kwords, int nkwords[], int to_reset);
-void reset_kwords(char ***kwords, int nkwords[]);
-void add_keyword(char ***kwords, int player, int nkwords[], char* keyword);
-void insert_text(char* main, char* inserted, int where);
+int num_cookies(char** cookies, int max_cookies);
+int check_victory(struct keyword** kwords, int nkwords[], int player, int added, struct keyword_stats* stats);
+int find_keyword(struct keyword list[], int n, unsigned long hash, char* key);
+unsigned long hash_keyword(char* key);
+void record_win(struct keyword_stats* stats, unsigned long hash, char* key);
+void load_keyword_stats(struct keyword_stats* stats);
+void save_keyword_stats(struct keyword_stats* stats);
+void reset_kword_of_player(struct keyword** kwords, int nkwords[], int to_reset);
+void reset_kwords(struct keyword** kwords, int nkwords[]);
+int add_keyword(struct keyword** kwords, int player, int nkwords[], char* keyword, struct capacity* capacity);
+void decode_keyword(char* keyword);
+void normalize_keyword(char* key, char* display);
+void html_escape(char* dest, char* src, int size);
+int hex_value(char c);
+void insert_text(char* main, char* inserted, int where, int size);
 
 //Functions for rotating the image
 int cycle(int i);
 void change_image();
 void change_image_of_file(char* filename, int index);
+int image_of_file(char* filename);
 
 void main(int argc, char *argv[]) {
   //Variables needed for networking stuff.
@@ -96,15 +154,14 @@ void main(int argc, char *argv[]) {
   int players[MAX_PLAYERS]={-1,-1};
   int nkwords[MAX_PLAYERS]={0,0};
   int playersstage[MAX_PLAYERS]={0,0};
-  char*** kwords;
-  kwords=(char***)malloc(sizeof(char***)*2);
+  struct keyword** kwords;
   int cur_player, cur_stage;
-  char request_type[MAX_REQUEST_TYPE], buffer[BUFFER_SIZE], *curr_request, requested_file[MAX_REQUESTED_FILE];
+  char request_type[MAX_REQUEST_TYPE], *buffer, *curr_request, requested_file[MAX_REQUESTED_FILE];
   int n;
   char* username;
-  char* cookies[50];
-  cookies[0]=(char*)malloc(sizeof(char*));
-  cookies[0]="\0";
+  char** cookies;
+  struct keyword_stats stats;
+  struct capacity capacity;
 
 
   //Fill IP and port from command line input.
@@ -113,6 +170,24 @@ void main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
+  //Read the capacity profile from any name=value arguments after the port.
+  if (!get_capacity(&capacity, argc, argv)) {
+    perror("error on capacity input");
+    exit(EXIT_FAILURE);
+  }
+
+  //Allocate the receive buffer and all guess and username storage up front so requests never have to.
+  kwords=(struct keyword**)malloc(sizeof(struct keyword*)*MAX_PLAYERS);
+  cookies=(char**)malloc(sizeof(char*)*capacity.max_cookies);
+  buffer=(char*)malloc(capacity.buffer_size);
+  if (kwords==NULL || cookies==NULL || buffer==NULL || !allocate_storage(kwords, cookies, &capacity)) {
+    perror("error on allocation");
+    exit(EXIT_FAILURE);
+  }
+
+  //Pick up winning keywords from earlier runs of the server.
+  load_keyword_stats(&stats);
+
   //Open an internet, TCP socket.
   sockfd = socket(AF_INET, SOCK_STREAM, 0);
   if (sockfd < 0) {
@@ -188,14 +263,18 @@ void main(int argc, char *argv[]) {
           cur_player=get_player(players, cur_fd);
           cur_stage=playersstage[cur_player];
 
-          n = read(cur_fd, buffer, 2049);
+          n = read(cur_fd, buffer, capacity.buffer_size-1);
           if (n <= 0) {
             if (n < 0) {
               perror("error on read");
             } else {
               printf("socket %d closed the connection\n", cur_fd);
               kill_player(players, cur_fd, nkwords, kwords, playersstage, &masterfds, cur_player);
+              if (stats.unsaved) {
+                save_keyword_stats(&stats);
+              }
             }
+            continue;
           }
 
           buffer[n] = 0;
@@ -212,7 +291,7 @@ void main(int argc, char *argv[]) {
           if (strstr(curr_request, "favicon.ico")) {
             send_404(cur_fd);
           } else {
-            handle_request(cur_stage, buffer, players, cur_fd, nkwords, kwords, playersstage, &masterfds, cur_player, username, request_type, cookies);
+            handle_request(cur_stage, buffer, players, cur_fd, nkwords, kwords, playersstage, &masterfds, cur_player, username, request_type, cookies, &stats, &capacity);
           }
 
         }
@@ -223,114 +302,120 @@ void main(int argc, char *argv[]) {
 
 
 //Wrapper function which splits up the game flow into multiple functions.
-void handle_request(int stage, char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* username, char* request_type, char* cookies[]) {
+void handle_request(int stage, char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* username, char* request_type, char** cookies, struct keyword_stats* stats, struct capacity* capacity) {
   if (stage == 0) {
-    handle_stage_zero(buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player, username, cookies);
+    handle_stage_zero(buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player, username, cookies, capacity);
   }
   else if (stage == 1) {
-    handle_stage_one(buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player, username, cookies);
+    handle_stage_one(buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player, username, cookies, capacity);
   }
   else if (stage == 2) {
     handle_stage_two(buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player, request_type);
   }
   else if (stage == 3) {
-    handle_stage_three(buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player, request_type);
+    handle_stage_three(buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player, request_type, stats, capacity);
   }
   else if (stage == 4) {
-    handle_stage_four(buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player);
+    handle_stage_four(buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player, stats, capacity);
   }
   else if (stage == 5) {
-    handle_stage_five(buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player);
+    handle_stage_five(buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player, stats, capacity);
   }
   else if (stage == 6) {
-    handle_stage_six(buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player, request_type);
+    handle_stage_six(buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player, request_type, stats);
   }
 }
 
 
 //Case where a player hasn't been sent anything yet. Simply send them to the intro page.
-void handle_stage_zero(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* username, char* cookies[]) {
+void handle_stage_zero(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* username, char** cookies, struct capacity* capacity) {
   int cookie = get_cookie(buffer);
-  if (cookie==-1) {
+  //Unknown or forged ids are treated as a new player.
+  if (cookie==-1 || cookie>=num_cookies(cookies, capacity->max_cookies)) {
     send_to_stage("1_intro.html", buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player);
   }
   else {
-    username = malloc(sizeof(cookies[cookie]));
-    strcpy(username, cookies[cookie]);
-    char welcome_line[100] = "<p>Welcome, ";
-    strcat(welcome_line, username);
-    strcat(welcome_line, "!</p>\n\n");
-    int null_loc = strlen("<p>Welcome, ")+strlen(username)+strlen("!</p>\n\n");
-    welcome_line[null_loc]='\0';
+    username = cookies[cookie];
+    char welcome_line[MAX_USERNAME_SIZE+32];
+    snprintf(welcome_line, sizeof(welcome_line), "<p>Welcome, %s!</p>\n\n", username);
 
     //Update the player's stage.
     playersstage[cur_player]=2;
 
     //Send the header and body.
     int htmlfd=open("2_start.html", O_RDONLY);
-    char html[10000];
-    int n=read(htmlfd, html, 10000);
+    char html[MAX_HTML_SIZE];
+    int n=read(htmlfd, html, MAX_HTML_SIZE-1);
+    close(htmlfd);
+    if (n<0) {
+      n=0;
+    }
     html[n]='\0';
 
-    insert_text(html, welcome_line, 239);
-    struct stat st;
-    stat("2_start.html", &st);
-    char buff[10000];
+    insert_text(html, welcome_line, 239, MAX_HTML_SIZE);
+    char buff[MAX_HTML_SIZE];
 
-    int k=sprintf(buff, HTTP_200_FORMAT, st.st_size+strlen(welcome_line));
+    int k=sprintf(buff, HTTP_200_FORMAT, strlen(html));
     write(fd, buff, k);
-    write(fd, html, n+strlen(welcome_line));
+    write(fd, html, strlen(html));
   }
 }
 
 //Player entered their username.
-void handle_stage_one(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* username, char* cookies[]) {
+void handle_stage_one(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* username, char** cookies, struct capacity* capacity) {
   //Read the username and construct the welcome line to insert into the response body.
-  username = strstr(buffer, "user=") + 5;
-  int i=0;
-  while (strcmp(cookies[i], "\0")!=0) {
-    i++;
+  username = strstr(buffer, "user=");
+  int i=num_cookies(cookies, capacity->max_cookies);
+  //Reject requests without a username, or when every cookie slot is taken.
+  if (username==NULL || i>=capacity->max_cookies) {
+    send_400(fd);
+    return;
   }
+  username += 5;
+
+  //Isolate just what was entered, truncated to fit a cookie slot.
+  //An empty name would read as a free slot, so it is rejected too.
+  int len=strcspn(username, "&\r\n");
+  if (len==0) {
+    send_400(fd);
+    return;
+  }
+  if (len>=MAX_USERNAME_SIZE) {
+    len=MAX_USERNAME_SIZE-1;
+  }
+  memcpy(cookies[i], username, len);
+  cookies[i][len]='\0';
+  username=cookies[i];
 
-  cookies[i]=(char*)malloc(sizeof(username));
-  strcpy(cookies[i], username);
-  strcat(cookies[i], "\0");
-  cookies[i+1]="\0";
-
-  char welcome_line[100] = "<p>Welcome, ";
-  strcat(welcome_line, username);
-  strcat(welcome_line, "!</p>\n\n");
-  int null_loc = strlen("<p>Welcome, ")+strlen(username)+strlen("!</p>\n\n");
-  welcome_line[null_loc]='\0';
+  char welcome_line[MAX_USERNAME_SIZE+32];
+  snprintf(welcome_line, sizeof(welcome_line), "<p>Welcome, %s!</p>\n\n", username);
 
   char cookie_line[100];
-  strcpy(cookie_line, COOKIE);
-  char cookie_str[100];
-  sprintf(cookie_str, "%d", i);
-  strcat(cookie_line, cookie_str);
-  strcat(cookie_line, "\r\n\r\n");
+  snprintf(cookie_line, sizeof(cookie_line), "%s%d\r\n\r\n", COOKIE, i);
 
   //Update the player's stage.
   playersstage[cur_player]=2;
 
   //Send the header and body.
   int htmlfd=open("2_start.html", O_RDONLY);
-  char html[10000];
-  int n=read(htmlfd, html, 10000);
+  char html[MAX_HTML_SIZE];
+  int n=read(htmlfd, html, MAX_HTML_SIZE-1);
+  close(htmlfd);
+  if (n<0) {
+    n=0;
+  }
   html[n]='\0';
 
-  insert_text(html, welcome_line, 239);
-  struct stat st;
-  stat("2_start.html", &st);
-  char buff[10000];
-  int k=sprintf(buff, HTTP_200_FORMAT_C, st.st_size+strlen(welcome_line));
+  insert_text(html, welcome_line, 239, MAX_HTML_SIZE);
+  char buff[MAX_HTML_SIZE];
+  int k=sprintf(buff, HTTP_200_FORMAT_C, strlen(html));
   strcat(buff, cookie_line);
   write(fd, buff, k+strlen(cookie_line));
-  write(fd, html, n+strlen(welcome_line));
+  write(fd, html, strlen(html));
 }
 
 //Player has option to start the game or leave.
-void handle_stage_two(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* request_type) {
+void handle_stage_two(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* request_type) {
   //If the player wants to start, reset the keywords for that player incase a previous round has been played, and sen them to their first turn.
   if (strcmp(request_type, "GET")==0) {
     send_to_stage("3_first_turn.html", buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player);
@@ -341,18 +426,17 @@ void handle_stage_two(char* buffer, int players[], int fd, int nkwords[], char**
   }
 }
 
-void handle_stage_three(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* request_type) {
+void handle_stage_three(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* request_type, struct keyword_stats* stats, struct capacity* capacity) {
   char* keyword;
   if (strcmp(request_type, "POST")==0) {
     if (keyword=strstr(buffer, "keyword=")) {
       keyword=strstr(keyword, "=")+1;
       //If the other player has clicked start, then add this player's guess.
       if (playersstage[other_player(cur_player)]==3||playersstage[other_player(cur_player)]==4||playersstage[other_player(cur_player)]==5) {
-        kwords[cur_player]=(char**)malloc(sizeof(char**));
-        add_keyword(kwords, cur_player, nkwords, keyword);
+        int added=add_keyword(kwords, cur_player, nkwords, keyword, capacity);
 
         //Check for victory, if no one has won yet then accept this player's guess.
-        if (check_victory(kwords, nkwords)==1) {
+        if (check_victory(kwords, nkwords, cur_player, added, stats)==1) {
           send_to_stage("6_endgame.html", buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player);
         }
         else {
@@ -372,12 +456,12 @@ void handle_stage_three(char* buffer, int players[], int fd, int nkwords[], char
 }
 
 //A guess was accepted, game is going.
-void handle_stage_four(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player) {
+void handle_stage_four(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, struct keyword_stats* stats, struct capacity* capacity) {
   char* keyword;
   if (keyword=strstr(buffer, "keyword=")) {
     keyword=strstr(keyword, "=")+1;
-    add_keyword(kwords, cur_player, nkwords, keyword);
-    if (check_victory(kwords, nkwords)==1) {
+    int added=add_keyword(kwords, cur_player, nkwords, keyword, capacity);
+    if (check_victory(kwords, nkwords, cur_player, added, stats)==1) {
       send_to_stage("6_endgame.html", buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player);
     }
     else {
@@ -391,14 +475,14 @@ void handle_stage_four(char* buffer, int players[], int fd, int nkwords[], char*
 }
 
 //The player's guess was denied.
-void handle_stage_five(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player) {
+void handle_stage_five(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, struct keyword_stats* stats, struct capacity* capacity) {
   char* keyword;
   if (keyword=strstr(buffer, "keyword=")) {
     keyword=strstr(keyword, "=")+1;
     //Accept their guess if the other player is ready.
     if (playersstage[other_player(cur_player)]==3||playersstage[other_player(cur_player)]==4||playersstage[other_player(cur_player)]==5) {
-      add_keyword(kwords, cur_player, nkwords, keyword);
-      if (check_victory(kwords, nkwords)==1) {
+      int added=add_keyword(kwords, cur_player, nkwords, keyword, capacity);
+      if (check_victory(kwords, nkwords, cur_player, added, stats)==1) {
         send_to_stage("6_endgame.html", buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player);
       }
       else {
@@ -416,7 +500,12 @@ void handle_stage_five(char* buffer, int players[], int fd, int nkwords[], char*
 }
 
 //The round was won.
-void handle_stage_six(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* request_type) {
+void handle_stage_six(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player, char* request_type, struct keyword_stats* stats) {
+  //Write out the win this round added to the table.
+  if (stats->unsaved) {
+    save_keyword_stats(stats);
+  }
+
   //If the request is a get request, the player wants to play the game again with a different image.
   if (strcmp(request_type, "GET")==0) {
     reset_kword_of_player(kwords, nkwords, cur_player);
@@ -424,6 +513,7 @@ void handle_stage_six(char* buffer, int players[], int fd, int nkwords[], char**
     //Reset the image only if the other player hasn't.
     if (playersstage[other_player(cur_player)]!=3 && playersstage[other_player(cur_player)]!=5) {
       change_image();
+      stats->image=image_of_file("3_first_turn.html");
     }
     send_to_stage("3_first_turn.html", buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player);
   }
@@ -436,7 +526,7 @@ void handle_stage_six(char* buffer, int players[], int fd, int nkwords[], char**
 //--------------------- HELPER FUNCTIONS WHICH ARE NOT DIRECTLY RELATED TO GAME FLOW --------------------
 
 //Resets everything about a player.
-void kill_player(int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player) {
+void kill_player(int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player) {
   remove_player(players, fd);
   FD_CLR(fd, &(*masterfds));
   close(fd);
@@ -445,31 +535,40 @@ void kill_player(int players[], int fd, int nkwords[], char*** kwords, int playe
 }
 
 //Function inserts the list of keywords for the cur_player into the accepted HTML and then sends it to them.
-void send_accepted(int cur_player, int nkwords[], char*** kwords, int playersstage[], int fd) {
-  //Construct the string to insert
-  char keywords_string[10000] = "<p>Guesses:";
+void send_accepted(int cur_player, int nkwords[], struct keyword** kwords, int playersstage[], int fd) {
+  //Construct the string to insert, leaving room for the closing tag.
+  char keywords_string[MAX_HTML_SIZE/2] = "<p>Guesses:";
+  char const* const closing = "</p>\n\n";
+  size_t room=sizeof(keywords_string)-strlen(closing)-1;
+  char escaped[MAX_KEYWORD_SIZE*6];
   for (int i=0; i<nkwords[cur_player]; i++) {
+    //Guesses are shown decoded, so escape anything the page would read as markup.
+    html_escape(escaped, kwords[cur_player][i].display, sizeof(escaped));
+    if (strlen(keywords_string)+strlen(escaped)+2 > room) {
+      break;
+    }
     strcat(keywords_string, " ");
-    strcat(keywords_string, kwords[cur_player][i]);
+    strcat(keywords_string, escaped);
     if (i>=1) {
       strcat(keywords_string, ",");
     }
   }
-  strcat(keywords_string, "</p>\n\n");
-
-  struct stat st;
-  stat("4_accepted.html", &st);
+  strcat(keywords_string, closing);
 
   //Open the HTML file.
   int htmlfd=open("4_accepted.html", O_RDONLY);
-  char html[10000];
-  int n=read(htmlfd, html, 10000);
+  char html[MAX_HTML_SIZE];
+  int n=read(htmlfd, html, MAX_HTML_SIZE-1);
+  close(htmlfd);
+  if (n<0) {
+    n=0;
+  }
   html[n]='\0';
-  insert_text(html, keywords_string, 491);
+  insert_text(html, keywords_string, 491, MAX_HTML_SIZE);
 
   //Get the header.
-  char buff[10000];
-  int k=sprintf(buff, HTTP_200_FORMAT, st.st_size+strlen(keywords_string));
+  char buff[MAX_HTML_SIZE];
+  int k=sprintf(buff, HTTP_200_FORMAT, strlen(html));
 
   //Update the players stage.
   playersstage[cur_player]=4;
@@ -489,7 +588,7 @@ void send_400(int fd) {
 }
 
 //Sends a player a file, updates their tracker.
-void send_to_stage(char *stage, char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player) {
+void send_to_stage(char *stage, char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player) {
   if (send_file(stage, fd, buffer)==1) {
     playersstage[cur_player]=stage[0]-'0';
   }
@@ -502,7 +601,7 @@ void send_to_stage(char *stage, char* buffer, int players[], int fd, int nkwords
 
 
 //This is called whenever a player clicks on quit. Sends them the game_over html and clears any information stored about them.
-void player_quit(char* buffer, int players[], int fd, int nkwords[], char*** kwords, int playersstage[], fd_set* masterfds, int cur_player) {
+void player_quit(char* buffer, int players[], int fd, int nkwords[], struct keyword** kwords, int playersstage[], fd_set* masterfds, int cur_player) {
   send_to_stage("7_gameover.html", buffer, players, fd, nkwords, kwords, playersstage, masterfds, cur_player);
   kill_player(players, fd, nkwords, kwords, playersstage, masterfds, cur_player);
 }
@@ -584,6 +683,70 @@ int num_players(int players[]) {
   return count;
 }
 
+//Allocates every keyword and username slot once at startup, each player's guess text as one slab.
+//Returns 0 if memory ran out.
+int allocate_storage(struct keyword** kwords, char** cookies, struct capacity* capacity) {
+  int size=capacity->max_keyword_size;
+  for (int i=0; i<MAX_PLAYERS; i++) {
+    kwords[i]=(struct keyword*)malloc(sizeof(struct keyword)*capacity->max_keywords);
+    char* text=(char*)malloc((size_t)capacity->max_keywords*size*2);
+    if (kwords[i]==NULL || text==NULL) {
+      return 0;
+    }
+    for (int j=0; j<capacity->max_keywords; j++) {
+      kwords[i][j].display=text+(size_t)j*size*2;
+      kwords[i][j].key=kwords[i][j].display+size;
+      kwords[i][j].display[0]='\0';
+      kwords[i][j].key[0]='\0';
+    }
+  }
+  //An empty string marks a cookie slot which hasn't been handed out.
+  for (int i=0; i<capacity->max_cookies; i++) {
+    cookies[i]=(char*)malloc(MAX_USERNAME_SIZE);
+    if (cookies[i]==NULL) {
+      return 0;
+    }
+    cookies[i][0]='\0';
+  }
+  return 1;
+}
+
+//Fill the capacity profile from optional arguments after the port, for example "keywords=200 cookies=500".
+//Anything not given keeps its default. Returns 0 on an unknown name or a value out of range.
+int get_capacity(struct capacity* capacity, int argc, char *argv[]) {
+  capacity->max_keywords=MAX_KEYWORDS_PER_PLAYER;
+  capacity->max_keyword_size=MAX_KEYWORD_SIZE;
+  capacity->max_cookies=MAX_COOKIES;
+  capacity->buffer_size=BUFFER_SIZE;
+
+  for (int i=NUM_INPUTS; i<argc; i++) {
+    char* value=strchr(argv[i], '=');
+    if (value==NULL) {
+      return 0;
+    }
+    int name_len=value-argv[i];
+    char* end;
+    long number=strtol(value+1, &end, 10);
+    if (end==value+1 || *end!='\0' || number>MAX_CAPACITY) {
+      return 0;
+    }
+
+    if (name_len==8 && strncmp(argv[i], "keywords", 8)==0 && number>=1) {
+      capacity->max_keywords=number;
+    } else if (name_len==12 && strncmp(argv[i], "keyword_size", 12)==0 && number>=16) {
+      capacity->max_keyword_size=number;
+    } else if (name_len==7 && strncmp(argv[i], "cookies", 7)==0 && number>=1) {
+      capacity->max_cookies=number;
+    } else if (name_len==11 && strncmp(argv[i], "buffer_size", 11)==0 && number>=256) {
+      capacity->buffer_size=number;
+    } else {
+      return 0;
+    }
+  }
+  printf("Capacity: %d keywords of %d bytes per player, %d cookies, %d byte buffer\n", capacity->max_keywords, capacity->max_keyword_size, capacity->max_cookies, capacity->buffer_size);
+  return 1;
+}
+
 int getServerAddress(int *port, char IP[], int argc, char *argv[]) {
   //Return 0 if there weren't enough arguments specified, to indicate error.
   if (argc<NUM_INPUTS) {
@@ -605,7 +768,7 @@ int getServerAddress(int *port, char IP[], int argc, char *argv[]) {
 void change_image() {
   change_image_of_file("3_first_turn.html", 181);
   change_image_of_file("4_accepted.html", 198);
-  change_image_of_file("5_,discarded.html", 216);
+  change_image_of_file("5_discarded.html", 216);
 }
 
 //Find and change the image number, write it on the file.
@@ -613,11 +776,19 @@ void change_image_of_file(char* filename, int index) {
   int fd = open(filename, O_RDONLY);
   char buffer[2049];
   int n = read(fd, buffer, 2048);
+  close(fd);
+  if (n<=index) {
+    return;
+  }
   buffer[n]='\0';
 
   char buffer_copy[2049];
   strcpy(buffer_copy, buffer);
-  char* cur_image_str=strstr(buffer_copy, "image-")+6;
+  char* cur_image_str=strstr(buffer_copy, "image-");
+  if (cur_image_str==NULL || cur_image_str[6]=='\0') {
+    return;
+  }
+  cur_image_str+=6;
   cur_image_str[1]='\0';
   int cur_image=atoi(cur_image_str);
   int next_image=cycle(cur_image);
@@ -629,9 +800,31 @@ void change_image_of_file(char* filename, int index) {
 
   fd = open(filename, O_WRONLY);
   write(fd, buffer, strlen(buffer));
+  close(fd);
 
 }
 
+//Read which image a page is currently showing, or 1 if it can't be found.
+int image_of_file(char* filename) {
+  int fd = open(filename, O_RDONLY);
+  char buffer[2049];
+  int n = read(fd, buffer, 2048);
+  close(fd);
+  if (n<=0) {
+    return 1;
+  }
+  buffer[n]='\0';
+  char* cur_image_str=strstr(buffer, "image-");
+  if (cur_image_str==NULL) {
+    return 1;
+  }
+  int image=atoi(cur_image_str+6);
+  if (image<1 || image>NUM_IMAGES) {
+    return 1;
+  }
+  return image;
+}
+
 int cycle(int i) {
   if (i==4) {
     return 1;
@@ -649,7 +842,7 @@ int cycle(int i) {
 void determine_request(char *curr_request, char *request_type) {
   int marker_index=0;
   char marker=curr_request[marker_index];
-  while (marker!=' ') {
+  while (marker!=' ' && marker!='\0' && marker_index<MAX_REQUEST_TYPE-1) {
     request_type[marker_index]=marker;
     marker_index++;
     marker=curr_request[marker_index];
@@ -662,73 +855,324 @@ int get_cookie(char* request) {
   char* cookie_str;
   if (!(cookie_str = strstr(request, "Cookie: "))) {
     return -1;
-  } else {
-    cookie_str = strstr(cookie_str, "id=")+3;
-    char *marker;
-    marker = strchr(cookie_str, ';');
-    if (marker != NULL) {
-      *marker = '\0';
-    int cookie;
-    sprintf(cookie_str, "%d", cookie);
-    return cookie;
-    }
   }
+  if (!(cookie_str = strstr(cookie_str, "id="))) {
+    return -1;
+  }
+  cookie_str += 3;
+  //Only accept a plain, in-range index.
+  char* end;
+  long cookie = strtol(cookie_str, &end, 10);
+  if (end==cookie_str || cookie<0 || cookie>INT_MAX) {
+    return -1;
+  }
+  return (int)cookie;
 }
 
-//Checks victory condition by searching for matches between the keyword lists.
-int check_victory(char ***kwords, int nkwords[]) {
-  for (int i=0; i<nkwords[0]; i++) {
-    for (int j=0; j<nkwords[1]; j++) {
-      if (strcmp(kwords[0][i], kwords[1][j])==0) {
-        return 1;
+//Count the usernames which have been handed a cookie.
+int num_cookies(char** cookies, int max_cookies) {
+  int i=0;
+  while (i<max_cookies && strcmp(cookies[i], "\0")!=0) {
+    i++;
+  }
+  return i;
+}
+
+//Checks victory condition. Once a round is won it stays won, so the other player is sent to the end of it
+//on their next request, until either winning guess is cleared by a player restarting or leaving.
+//Otherwise a new match can only involve a guess which was just added, so only that one is looked up.
+int check_victory(struct keyword** kwords, int nkwords[], int player, int added, struct keyword_stats* stats) {
+  if (stats->round_won) {
+    int still_won=1;
+    for (int i=0; i<MAX_PLAYERS; i++) {
+      int index=stats->won_index[i];
+      if (index>=nkwords[i] || kwords[i][index].hash!=stats->won_hash) {
+        still_won=0;
       }
     }
+    if (still_won && strcmp(kwords[0][stats->won_index[0]].key, kwords[1][stats->won_index[1]].key)==0) {
+      return 1;
+    }
+    stats->round_won=0;
   }
-  return 0;
+  if (!added) {
+    return 0;
+  }
+
+  int other=other_player(player);
+  struct keyword* latest=&kwords[player][nkwords[player]-1];
+  int match=find_keyword(kwords[other], nkwords[other], latest->hash, latest->key);
+  if (match==-1) {
+    return 0;
+  }
+  //A new win, count it for this image once.
+  stats->round_won=1;
+  stats->won_index[player]=nkwords[player]-1;
+  stats->won_index[other]=match;
+  stats->won_hash=latest->hash;
+  record_win(stats, latest->hash, latest->key);
+  return 1;
+}
+
+//Looks for a keyword in a player's list, comparing hashes before strings. Returns its index, or -1.
+int find_keyword(struct keyword list[], int n, unsigned long hash, char* key) {
+  for (int i=0; i<n; i++) {
+    if (list[i].hash==hash && strcmp(list[i].key, key)==0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+//FNV-1a hash of a normalized keyword.
+unsigned long hash_keyword(char* key) {
+  unsigned long hash=14695981039346656037UL;
+  for (int i=0; key[i]!='\0'; i++) {
+    hash^=(unsigned char)key[i];
+    hash*=1099511628211UL;
+  }
+  return hash;
 }
 
 //Reset the tracker for both player's guesses.
-void reset_kwords(char ***kwords, int nkwords[]) {
+void reset_kwords(struct keyword** kwords, int nkwords[]) {
   reset_kword_of_player(kwords, nkwords, 0);
   reset_kword_of_player(kwords, nkwords, 1);
 
 }
 
-//Reset the track for a player's guesses.
-void reset_kword_of_player(char ***kwords, int nkwords[], int to_reset) {
+//Reset the track for a player's guesses. The slots stay allocated for the next round.
+void reset_kword_of_player(struct keyword** kwords, int nkwords[], int to_reset) {
   for (int i=0; i<nkwords[to_reset]; i++) {
-    kwords[to_reset][i][0]='\0';
-    free(kwords[to_reset][i]);
+    kwords[to_reset][i].display[0]='\0';
+    kwords[to_reset][i].key[0]='\0';
   }
-  free(kwords[to_reset]);
   nkwords[to_reset]=0;
 }
 
 //Inserts a string into another string at a given location, used for modifying HTML.
-void insert_text(char* main, char* inserted, int where) {
-  char final[1000];
-  strncpy(final, main, where);
-  final[where] = '\0';
-  strcat(final, inserted);
-  strcat(final, main+where);
+//The result is truncated to fit in size bytes.
+void insert_text(char* main, char* inserted, int where, int size) {
+  char final[MAX_HTML_SIZE];
+  if (size>MAX_HTML_SIZE) {
+    size=MAX_HTML_SIZE;
+  }
+  int len=strlen(main);
+  if (where>len) {
+    where=len;
+  }
+  snprintf(final, size, "%.*s%s%s", where, main, inserted, main+where);
   strcpy(main, final);
 }
 
-//Adds a keyword to the keyword tracker for the player.
-void add_keyword(char ***kwords, int player, int nkwords[], char* keyword) {
+//Adds a keyword to the keyword tracker for the player. Returns 1 if it was stored.
+int add_keyword(struct keyword** kwords, int player, int nkwords[], char* keyword, struct capacity* capacity) {
   //Isolate just what was entered
   char* marker;
   marker = strchr(keyword, '&');
   if (marker != NULL) {
     *marker = '\0';
   }
-  //Allocate space for the keyword.
-  kwords[player]=realloc(kwords[player], (sizeof(char**)*(nkwords[player]+1)));
-  kwords[player][nkwords[player]]=(char *)malloc(sizeof(keyword));
+  //Drop guesses once the player has hit the limit.
+  if (nkwords[player]>=capacity->max_keywords) {
+    return 0;
+  }
+  int len=strcspn(keyword, "\r\n");
+  if (len>=capacity->max_keyword_size) {
+    len=capacity->max_keyword_size-1;
+  }
+  keyword[len]='\0';
 
-  //Copy it and update the counts.
-  strcpy(kwords[player][nkwords[player]], keyword);
+  //Keep what was typed for display, and compare guesses on a normalized key.
+  struct keyword* slot=&kwords[player][nkwords[player]];
+  decode_keyword(keyword);
+  normalize_keyword(slot->key, keyword);
+  if (slot->key[0]=='\0') {
+    return 0;
+  }
+  strcpy(slot->display, keyword);
+  slot->hash=hash_keyword(slot->key);
   nkwords[player]++;
+  return 1;
+}
+
+//Decodes a URL-encoded form value in place.
+void decode_keyword(char* keyword) {
+  int read_index=0, write_index=0;
+  while (keyword[read_index]!='\0') {
+    char c=keyword[read_index++];
+    if (c=='+') {
+      c=' ';
+    }
+    else if (c=='%' && hex_value(keyword[read_index])>=0 && hex_value(keyword[read_index+1])>=0) {
+      c=hex_value(keyword[read_index])*16+hex_value(keyword[read_index+1]);
+      read_index+=2;
+    }
+    keyword[write_index++]=c;
+  }
+  keyword[write_index]='\0';
+}
+
+//Writes the comparison key for a decoded guess: lowercase words separated by single spaces,
+//so "Red  Car!" and "red car" are the same guess. Bytes outside ASCII are kept as they are.
+void normalize_keyword(char* key, char* display) {
+  int write_index=0, in_word=0;
+  for (int i=0; display[i]!='\0'; i++) {
+    unsigned char c=display[i];
+    if (isalnum(c) || c>=0x80) {
+      if (!in_word && write_index>0) {
+        key[write_index++]=' ';
+      }
+      key[write_index++]=tolower(c);
+      in_word=1;
+    }
+    else {
+      in_word=0;
+    }
+  }
+  key[write_index]='\0';
+}
+
+//Copies src into dest with HTML special characters escaped, truncated to fit in size bytes.
+void html_escape(char* dest, char* src, int size) {
+  int write_index=0;
+  for (int i=0; src[i]!='\0'; i++) {
+    char const* replacement;
+    char single[2]={src[i], '\0'};
+    if (src[i]=='<') {
+      replacement="&lt;";
+    } else if (src[i]=='>') {
+      replacement="&gt;";
+    } else if (src[i]=='&') {
+      replacement="&amp;";
+    } else if (src[i]=='"') {
+      replacement="&quot;";
+    } else if (src[i]=='\'') {
+      replacement="&#39;";
+    } else {
+      replacement=single;
+    }
+    int len=strlen(replacement);
+    if (write_index+len>=size) {
+      break;
+    }
+    memcpy(dest+write_index, replacement, len);
+    write_index+=len;
+  }
+  dest[write_index]='\0';
+}
+
+//Value of a single hex digit, or -1 if it isn't one.
+int hex_value(char c) {
+  if (c>='0' && c<='9') {
+    return c-'0';
+  }
+  if (c>='a' && c<='f') {
+    return c-'a'+10;
+  }
+  if (c>='A' && c<='F') {
+    return c-'A'+10;
+  }
+  return -1;
+}
+
+//-----------------------------------------------------------------------------------
+
+
+//--------------------- FUNCTIONS USED TO TRACK WINNING KEYWORDS --------------------
+//Count a win on the current image, keeping the table ordered from most to least frequent.
+//The table is written out later by save_keyword_stats().
+void record_win(struct keyword_stats* stats, unsigned long hash, char* key) {
+  if (strlen(key)>=MAX_KEYWORD_SIZE) {
+    return;
+  }
+  int image=stats->image;
+  int i=0;
+  while (i<stats->nwinners[image] && !(stats->hash[image][i]==hash && strcmp(stats->key[image][i], key)==0)) {
+    i++;
+  }
+  if (i==stats->nwinners[image]) {
+    //The table is full, so this keyword takes the least frequent slot.
+    if (i==MAX_WINNING_KEYWORDS) {
+      i--;
+    } else {
+      stats->nwinners[image]++;
+    }
+    stats->count[image][i]=0;
+    stats->hash[image][i]=hash;
+    strcpy(stats->key[image][i], key);
+  }
+  stats->count[image][i]++;
+
+  //Move it up past anything which has won less often.
+  while (i>0 && stats->count[image][i-1]<stats->count[image][i]) {
+    int count=stats->count[image][i];
+    unsigned long swap_hash=stats->hash[image][i];
+    char swap_key[MAX_KEYWORD_SIZE];
+    strcpy(swap_key, stats->key[image][i]);
+    stats->count[image][i]=stats->count[image][i-1];
+    stats->hash[image][i]=stats->hash[image][i-1];
+    strcpy(stats->key[image][i], stats->key[image][i-1]);
+    stats->count[image][i-1]=count;
+    stats->hash[image][i-1]=swap_hash;
+    strcpy(stats->key[image][i-1], swap_key);
+    i--;
+  }
+  stats->unsaved=1;
+}
+
+//Fill the table from the stats file, one "image count keyword" line per entry. A missing file leaves it empty.
+void load_keyword_stats(struct keyword_stats* stats) {
+  memset(stats, 0, sizeof(struct keyword_stats));
+  stats->image=image_of_file("3_first_turn.html");
+
+  if (KEYWORD_STATS_FILE[0]=='\0') {
+    return;
+  }
+  FILE* file=fopen(KEYWORD_STATS_FILE, "r");
+  if (file==NULL) {
+    return;
+  }
+  char line[MAX_KEYWORD_SIZE+32];
+  while (fgets(line, sizeof(line), file)!=NULL) {
+    int image, count, key_start;
+    if (sscanf(line, "%d %d %n", &image, &count, &key_start)!=2 || image<1 || image>NUM_IMAGES || count<1) {
+      continue;
+    }
+    char* key=line+key_start;
+    key[strcspn(key, "\r\n")]='\0';
+    int i=stats->nwinners[image];
+    if (key[0]=='\0' || strlen(key)>=MAX_KEYWORD_SIZE || i==MAX_WINNING_KEYWORDS) {
+      continue;
+    }
+    stats->count[image][i]=count;
+    stats->hash[image][i]=hash_keyword(key);
+    strcpy(stats->key[image][i], key);
+    stats->nwinners[image]++;
+  }
+  fclose(file);
+}
+
+//Write the whole table to the stats file.
+void save_keyword_stats(struct keyword_stats* stats) {
+  if (KEYWORD_STATS_FILE[0]=='\0') {
+    stats->unsaved=0;
+    return;
+  }
+  int fd=open(KEYWORD_STATS_FILE, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd<0) {
+    perror("error on saving keyword stats");
+    return;
+  }
+  char line[MAX_KEYWORD_SIZE+32];
+  for (int image=1; image<=NUM_IMAGES; image++) {
+    for (int i=0; i<stats->nwinners[image]; i++) {
+      int n=snprintf(line, sizeof(line), "%d %d %s\n", image, stats->count[image][i], stats->key[image][i]);
+      write(fd, line, n);
+    }
+  }
+  close(fd);
+  stats->unsaved=0;
 }
 
 //-----------------------------------------------------------------------------------